@@ -1,5 +1,7 @@
 #pragma once
 
+#include <memory_resource>
+#include <optional>
 #include <stdexcept>
 #include <stdint.h>
 #include <string>
@@ -76,6 +78,15 @@ struct Pixel
     uint8_t a;
 };
 
+// An 8-bit indexed mipmap. Every distinct (palette index, alpha) pair of the source gets its own
+// entry, so this is only available for paletted formats using at most 256 such pairs.
+struct PalettedMipmap
+{
+    std::pmr::vector<uint8_t> indices; // One index into `palette` per pixel
+    std::pmr::vector<Pixel> palette;   // Up to 256 BGRA colors
+    bool hasAlpha;                     // False if every color of `palette` is opaque
+};
+
 // A description of the BLP2 format can be found on Wikipedia: http://en.wikipedia.org/wiki/.BLP
 struct Header
 {
@@ -106,38 +117,54 @@ struct Header
 
     std::string friendlyFormat() const;
 
-    std::vector<Pixel> getMipmap(std::string_view data, uint32_t mipLevel = 0) const;
+    // The decoded pixels are allocated from `resource`
+    std::pmr::vector<Pixel>
+    getMipmap(std::string_view data,
+              uint32_t mipLevel = 0,
+              std::pmr::memory_resource *resource = std::pmr::get_default_resource()) const;
+    std::optional<PalettedMipmap>
+    getPalettedMipmap(std::string_view data,
+                      uint32_t mipLevel = 0,
+                      std::pmr::memory_resource *resource = std::pmr::get_default_resource()) const;
 
   public:
     static Header fromBinary(std::string_view data);
     static std::string friendlyFormat(tBLPFormat format);
 
   private:
-    static std::vector<Pixel> convertPalettedNoAlpha(std::string_view mipmap,
-                                                     const Header &header,
-                                                     unsigned int width,
-                                                     unsigned int height);
-    static std::vector<Pixel> convertPalettedAlpha1(std::string_view mipmap,
-                                                    const Header &header,
-                                                    unsigned int width,
-                                                    unsigned int height);
-    static std::vector<Pixel> convertPalettedAlpha4(std::string_view mipmap,
-                                                    const Header &header,
-                                                    unsigned int width,
-                                                    unsigned int height);
-    static std::vector<Pixel> convertPalettedAlpha8(std::string_view mipmap,
-                                                    const Header &header,
-                                                    unsigned int width,
-                                                    unsigned int height);
-    static std::vector<Pixel> convertRawBgra(std::string_view mipmap,
-                                             const Header &header,
-                                             unsigned int width,
-                                             unsigned int height);
-    static std::vector<Pixel> convertDxt(std::string_view mipmap,
-                                         const Header &header,
-                                         unsigned int width,
-                                         unsigned int height,
-                                         int flags);
+    std::string_view mipmapData(std::string_view data, uint32_t mipLevel) const;
+
+    static std::pmr::vector<Pixel> convertPalettedNoAlpha(std::string_view mipmap,
+                                                          const Header &header,
+                                                          unsigned int width,
+                                                          unsigned int height,
+                                                          std::pmr::memory_resource *resource);
+    static std::pmr::vector<Pixel> convertPalettedAlpha1(std::string_view mipmap,
+                                                         const Header &header,
+                                                         unsigned int width,
+                                                         unsigned int height,
+                                                         std::pmr::memory_resource *resource);
+    static std::pmr::vector<Pixel> convertPalettedAlpha4(std::string_view mipmap,
+                                                         const Header &header,
+                                                         unsigned int width,
+                                                         unsigned int height,
+                                                         std::pmr::memory_resource *resource);
+    static std::pmr::vector<Pixel> convertPalettedAlpha8(std::string_view mipmap,
+                                                         const Header &header,
+                                                         unsigned int width,
+                                                         unsigned int height,
+                                                         std::pmr::memory_resource *resource);
+    static std::pmr::vector<Pixel> convertRawBgra(std::string_view mipmap,
+                                                  const Header &header,
+                                                  unsigned int width,
+                                                  unsigned int height,
+                                                  std::pmr::memory_resource *resource);
+    static std::pmr::vector<Pixel> convertDxt(std::string_view mipmap,
+                                              const Header &header,
+                                              unsigned int width,
+                                              unsigned int height,
+                                              int flags,
+                                              std::pmr::memory_resource *resource);
 };
 
 static_assert(is_pod_v<Header>);
@@ -10,7 +10,6 @@
 
 using std::string;
 using std::string_view;
-using std::vector;
 using namespace std::literals;
 
 namespace blp
@@ -56,7 +55,9 @@ string Header::friendlyFormat() const
     return friendlyFormat(format());
 }
 
-std::vector<Pixel> Header::getMipmap(string_view data, uint32_t mipLevel) const
+std::pmr::vector<Pixel> Header::getMipmap(string_view data,
+                                          uint32_t mipLevel,
+                                          std::pmr::memory_resource *resource) const
 {
     if (mipLevel >= nbMipLevels)
         mipLevel = nbMipLevels - 1;
@@ -64,42 +65,117 @@ std::vector<Pixel> Header::getMipmap(string_view data, uint32_t mipLevel) const
     unsigned mipWidth = width(mipLevel);
     unsigned mipHeight = height(mipLevel);
 
-    auto offset = offsets[mipLevel];
-    auto size = lengths[mipLevel];
-
-    if (data.size() < offset + size)
-        throw BLPError("Invalid BLP2 file: mipmap data is truncated");
-
-    string_view mipmap = data.substr(offset, size);
+    string_view mipmap = mipmapData(data, mipLevel);
 
     switch (format())
     {
     case BLP_FORMAT_PALETTED_NO_ALPHA:
-        return convertPalettedNoAlpha(mipmap, *this, mipWidth, mipHeight);
+        return convertPalettedNoAlpha(mipmap, *this, mipWidth, mipHeight, resource);
     case BLP_FORMAT_PALETTED_ALPHA_1:
-        return convertPalettedAlpha1(mipmap, *this, mipWidth, mipHeight);
+        return convertPalettedAlpha1(mipmap, *this, mipWidth, mipHeight, resource);
     case BLP_FORMAT_PALETTED_ALPHA_4:
-        return convertPalettedAlpha4(mipmap, *this, mipWidth, mipHeight);
+        return convertPalettedAlpha4(mipmap, *this, mipWidth, mipHeight, resource);
     case BLP_FORMAT_PALETTED_ALPHA_8:
-        return convertPalettedAlpha8(mipmap, *this, mipWidth, mipHeight);
+        return convertPalettedAlpha8(mipmap, *this, mipWidth, mipHeight, resource);
 
     case BLP_FORMAT_RAW_BGRA:
-        return convertRawBgra(mipmap, *this, mipWidth, mipHeight);
+        return convertRawBgra(mipmap, *this, mipWidth, mipHeight, resource);
 
     case BLP_FORMAT_DXT1_NO_ALPHA:
     case BLP_FORMAT_DXT1_ALPHA_1:
-        return convertDxt(mipmap, *this, mipWidth, mipHeight, squish::kDxt1);
+        return convertDxt(mipmap, *this, mipWidth, mipHeight, squish::kDxt1, resource);
     case BLP_FORMAT_DXT3_ALPHA_4:
     case BLP_FORMAT_DXT3_ALPHA_8:
-        return convertDxt(mipmap, *this, mipWidth, mipHeight, squish::kDxt3);
+        return convertDxt(mipmap, *this, mipWidth, mipHeight, squish::kDxt3, resource);
     case BLP_FORMAT_DXT5_ALPHA_8:
-        return convertDxt(mipmap, *this, mipWidth, mipHeight, squish::kDxt5);
+        return convertDxt(mipmap, *this, mipWidth, mipHeight, squish::kDxt5, resource);
 
     default:
         throw BLPError("Unsupported BLP2 format: " + friendlyFormat());
     }
 }
 
+std::optional<PalettedMipmap> Header::getPalettedMipmap(string_view data,
+                                                        uint32_t mipLevel,
+                                                        std::pmr::memory_resource *resource) const
+{
+    switch (format())
+    {
+    case BLP_FORMAT_PALETTED_NO_ALPHA:
+    case BLP_FORMAT_PALETTED_ALPHA_1:
+    case BLP_FORMAT_PALETTED_ALPHA_4:
+    case BLP_FORMAT_PALETTED_ALPHA_8:
+        break;
+    default:
+        return std::nullopt;
+    }
+
+    if (mipLevel >= nbMipLevels)
+        mipLevel = nbMipLevels - 1;
+
+    unsigned nbPixels = width(mipLevel) * height(mipLevel);
+
+    string_view mipmap = mipmapData(data, mipLevel);
+
+    auto expectedLength = nbPixels + (nbPixels * alphaDepth + 7) / 8;
+    if (mipmap.size() < expectedLength)
+        throw BLPError(
+            fmt::format("Invalid BLP2 paletted mipmap: too short ({0} expected, {1} provided)",
+                        expectedLength,
+                        mipmap.size()));
+
+    auto src = reinterpret_cast<const uint8_t *>(mipmap.data());
+
+    PalettedMipmap result{std::pmr::vector<uint8_t>(nbPixels, resource),
+                          std::pmr::vector<Pixel>(resource),
+                          false};
+
+    if (alphaDepth == BLP_ALPHA_DEPTH_0)
+    {
+        memcpy(result.indices.data(), src, nbPixels);
+        result.palette.assign(palette, palette + 256);
+        for (auto &color : result.palette)
+            color.a = 0xFF;
+        return result;
+    }
+
+    // Maps (palette index << 8 | alpha) to the index of the matching color in the result
+    std::pmr::vector<int16_t> remap(256 * 256, -1, resource);
+    const uint8_t *alphas = src + nbPixels;
+    for (uint32_t idx = 0; idx < nbPixels; ++idx)
+    {
+        uint8_t alpha;
+        switch (alphaDepth)
+        {
+        case BLP_ALPHA_DEPTH_1:
+            alpha = (alphas[idx / 8] & (1 << (idx % 8))) ? 0xFF : 0x00;
+            break;
+        case BLP_ALPHA_DEPTH_4:
+            alpha = (alphas[idx / 2] >> (idx % 2 * 4)) & 0xF;
+            alpha = (alpha << 4) | alpha;
+            break;
+        default:
+            alpha = alphas[idx];
+            break;
+        }
+
+        int16_t &entry = remap[(src[idx] << 8) | alpha];
+        if (entry < 0)
+        {
+            if (result.palette.size() == 256)
+                return std::nullopt;
+
+            entry = int16_t(result.palette.size());
+            Pixel color = palette[src[idx]];
+            color.a = alpha;
+            result.palette.push_back(color);
+            result.hasAlpha |= (alpha != 0xFF);
+        }
+        result.indices[idx] = uint8_t(entry);
+    }
+    return result;
+}
+
 Header Header::fromBinary(std::string_view data)
 {
     if (data.size() < 4)
@@ -156,10 +232,22 @@ std::string Header::friendlyFormat(tBLPFormat format)
     }
 }
 
-vector<Pixel> Header::convertPalettedNoAlpha(string_view mipmap,
-                                             const Header &header,
-                                             unsigned int width,
-                                             unsigned int height)
+string_view Header::mipmapData(string_view data, uint32_t mipLevel) const
+{
+    auto offset = offsets[mipLevel];
+    auto size = lengths[mipLevel];
+
+    if (data.size() < offset + size)
+        throw BLPError("Invalid BLP2 file: mipmap data is truncated");
+
+    return data.substr(offset, size);
+}
+
+std::pmr::vector<Pixel> Header::convertPalettedNoAlpha(string_view mipmap,
+                                                       const Header &header,
+                                                       unsigned int width,
+                                                       unsigned int height,
+                                                       std::pmr::memory_resource *resource)
 {
     auto expectedLength = width * height;
     if (mipmap.size() < expectedLength)
@@ -168,7 +256,7 @@ vector<Pixel> Header::convertPalettedNoAlpha(string_view mipmap,
                         expectedLength,
                         mipmap.size()));
 
-    vector<Pixel> result(width * height);
+    std::pmr::vector<Pixel> result(width * height, resource);
     for (uint32_t idx = 0; idx < width * height; ++idx)
     {
         result[idx] = header.palette[mipmap[idx]];
@@ -177,10 +265,11 @@ vector<Pixel> Header::convertPalettedNoAlpha(string_view mipmap,
     return result;
 }
 
-vector<Pixel> Header::convertPalettedAlpha1(string_view mipmap,
-                                            const Header &header,
-                                            unsigned int width,
-                                            unsigned int height)
+std::pmr::vector<Pixel> Header::convertPalettedAlpha1(string_view mipmap,
+                                                      const Header &header,
+                                                      unsigned int width,
+                                                      unsigned int height,
+                                                      std::pmr::memory_resource *resource)
 {
     auto expectedLength = width * height + (width * height + 7) / 8;
     if (mipmap.size() < expectedLength)
@@ -189,7 +278,7 @@ vector<Pixel> Header::convertPalettedAlpha1(string_view mipmap,
                         expectedLength,
                         mipmap.size()));
 
-    vector<Pixel> result(width * height);
+    std::pmr::vector<Pixel> result(width * height, resource);
     for (uint32_t idx = 0; idx < width * height; ++idx)
     {
         auto alphaIdx = width * height + idx / 8;
@@ -200,10 +289,11 @@ vector<Pixel> Header::convertPalettedAlpha1(string_view mipmap,
     return result;
 }
 
-vector<Pixel> Header::convertPalettedAlpha4(string_view mipmap,
-                                            const Header &header,
-                                            unsigned int width,
-                                            unsigned int height)
+std::pmr::vector<Pixel> Header::convertPalettedAlpha4(string_view mipmap,
+                                                      const Header &header,
+                                                      unsigned int width,
+                                                      unsigned int height,
+                                                      std::pmr::memory_resource *resource)
 {
     auto expectedLength = width * height + (width * height + 1) / 2;
     if (mipmap.size() < expectedLength)
@@ -212,7 +302,7 @@ vector<Pixel> Header::convertPalettedAlpha4(string_view mipmap,
                         expectedLength,
                         mipmap.size()));
 
-    vector<Pixel> result(width * height);
+    std::pmr::vector<Pixel> result(width * height, resource);
     for (uint32_t idx = 0; idx < width * height; ++idx)
     {
         auto alphaIdx = width * height + idx / 2;
@@ -224,10 +314,11 @@ vector<Pixel> Header::convertPalettedAlpha4(string_view mipmap,
     return result;
 }
 
-vector<Pixel> Header::convertPalettedAlpha8(string_view mipmap,
-                                            const Header &header,
-                                            unsigned int width,
-                                            unsigned int height)
+std::pmr::vector<Pixel> Header::convertPalettedAlpha8(string_view mipmap,
+                                                      const Header &header,
+                                                      unsigned int width,
+                                                      unsigned int height,
+                                                      std::pmr::memory_resource *resource)
 {
     auto expectedLength = width * height * 2;
     if (mipmap.size() < expectedLength)
@@ -236,7 +327,7 @@ vector<Pixel> Header::convertPalettedAlpha8(string_view mipmap,
                         expectedLength,
                         mipmap.size()));
 
-    vector<Pixel> result(width * height);
+    std::pmr::vector<Pixel> result(width * height, resource);
     for (uint32_t idx = 0; idx < width * height; ++idx)
     {
         auto alphaIdx = width * height + idx;
@@ -246,10 +337,11 @@ vector<Pixel> Header::convertPalettedAlpha8(string_view mipmap,
     return result;
 }
 
-vector<Pixel> Header::convertRawBgra(std::string_view mipmap,
-                                     const Header &header,
-                                     unsigned int width,
-                                     unsigned int height)
+std::pmr::vector<Pixel> Header::convertRawBgra(std::string_view mipmap,
+                                               const Header &header,
+                                               unsigned int width,
+                                               unsigned int height,
+                                               std::pmr::memory_resource *resource)
 {
     auto expectedLength = width * height * 4;
     if (mipmap.size() < expectedLength)
@@ -258,15 +350,19 @@ vector<Pixel> Header::convertRawBgra(std::string_view mipmap,
                         expectedLength,
                         mipmap.size()));
 
-    vector<Pixel> result(width * height);
+    std::pmr::vector<Pixel> result(width * height, resource);
     memcpy(result.data(), mipmap.data(), width * height * 4);
     return result;
 }
 
-vector<Pixel> Header::convertDxt(
-    string_view mipmap, const Header &header, unsigned int width, unsigned int height, int flags)
+std::pmr::vector<Pixel> Header::convertDxt(string_view mipmap,
+                                           const Header &header,
+                                           unsigned int width,
+                                           unsigned int height,
+                                           int flags,
+                                           std::pmr::memory_resource *resource)
 {
-    vector<Pixel> result(width * height);
+    std::pmr::vector<Pixel> result(width * height, resource);
     squish::DecompressImage(reinterpret_cast<squish::u8 *>(result.data()),
                             width,
                             height,
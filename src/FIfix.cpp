@@ -10,6 +10,27 @@ FIBITMAP_ptr::FIBITMAP_ptr(
 {
 }
 
+FIBITMAP_ptr::FIBITMAP_ptr(uint8_t *bits,
+                           int pitch,
+                           int width,
+                           int height,
+                           int bpp,
+                           unsigned red_mask,
+                           unsigned green_mask,
+                           unsigned blue_mask)
+    : std::unique_ptr<FIBITMAP, void (*)(FIBITMAP *)>(
+          FreeImage_AllocateHeaderForBits(
+              bits, pitch, FIT_BITMAP, width, height, bpp, red_mask, green_mask, blue_mask),
+          &FreeImage_Unload)
+{
+}
+
+FIMEMORY_ptr::FIMEMORY_ptr()
+    : std::unique_ptr<FIMEMORY, void (*)(FIMEMORY *)>(FreeImage_OpenMemory(),
+                                                      &FreeImage_CloseMemory)
+{
+}
+
 namespace freeimage
 {
 
@@ -28,19 +49,32 @@ uint8_t *GetScanLine(FIBITMAP *dib, int scanline)
     return FreeImage_GetScanLine(dib, scanline);
 }
 
-template <typename Char>
-bool SaveImpl(Format format, FIBITMAP *dib, const Char *filename, int flags)
+uint8_t *GetPalette(FIBITMAP *dib)
+{
+    return reinterpret_cast<uint8_t *>(FreeImage_GetPalette(dib));
+}
+
+void SetTransparencyTable(FIBITMAP *dib, const uint8_t *table, int count)
+{
+    FreeImage_SetTransparencyTable(dib, const_cast<BYTE *>(table), count);
+}
+
+FREE_IMAGE_FORMAT ToFif(Format format)
 {
-    FREE_IMAGE_FORMAT fif = FIF_PNG;
     switch (format)
     {
-    case Format::PNG:
-        fif = FIF_PNG;
-        break;
     case Format::TARGA:
-        fif = FIF_TARGA;
-        break;
+        return FIF_TARGA;
+    case Format::PNG:
+    default:
+        return FIF_PNG;
     }
+}
+
+template <typename Char>
+bool SaveImpl(Format format, FIBITMAP *dib, const Char *filename, int flags)
+{
+    FREE_IMAGE_FORMAT fif = ToFif(format);
     if constexpr (std::is_same_v<Char, wchar_t>)
         return FreeImage_SaveU(fif, dib, filename, flags);
     else
@@ -57,4 +91,19 @@ bool Save(Format format, FIBITMAP *dib, const wchar_t *filename, int flags)
     return SaveImpl(format, dib, filename, flags);
 }
 
+bool SaveToMemory(Format format, FIBITMAP *dib, FIMEMORY *stream, int flags)
+{
+    return stream && FreeImage_SaveToMemory(ToFif(format), dib, stream, flags);
+}
+
+std::string_view AcquireMemory(FIMEMORY *stream)
+{
+    BYTE *buffer = nullptr;
+    DWORD size = 0;
+    if (!FreeImage_AcquireMemory(stream, &buffer, &size))
+        return std::string_view();
+
+    return std::string_view(reinterpret_cast<const char *>(buffer), size);
+}
+
 } // namespace freeimage
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <string_view>
 
 struct FIBITMAP;
+struct FIMEMORY;
 
 struct FIBITMAP_ptr : public std::unique_ptr<FIBITMAP, void (*)(FIBITMAP *)>
 {
@@ -13,12 +16,33 @@ struct FIBITMAP_ptr : public std::unique_ptr<FIBITMAP, void (*)(FIBITMAP *)>
                  unsigned green_mask = 0,
                  unsigned blue_mask = 0);
 
+    // Uses the given bottom-up scanlines of `pitch` bytes, which must outlive the bitmap
+    FIBITMAP_ptr(uint8_t *bits,
+                 int pitch,
+                 int width,
+                 int height,
+                 int bpp,
+                 unsigned red_mask = 0,
+                 unsigned green_mask = 0,
+                 unsigned blue_mask = 0);
+
     operator FIBITMAP *() const
     {
         return get();
     }
 };
 
+// Memory stream, growing as needed when an image is saved into it
+struct FIMEMORY_ptr : public std::unique_ptr<FIMEMORY, void (*)(FIMEMORY *)>
+{
+    FIMEMORY_ptr();
+
+    operator FIMEMORY *() const
+    {
+        return get();
+    }
+};
+
 namespace freeimage
 {
 
@@ -34,7 +58,16 @@ void DeInitialise();
 
 uint8_t *GetScanLine(FIBITMAP *dib, int scanline);
 
+uint8_t *GetPalette(FIBITMAP *dib);
+
+void SetTransparencyTable(FIBITMAP *dib, const uint8_t *table, int count);
+
 bool Save(Format fif, FIBITMAP *dib, const char *filename, int flags = 0);
 bool Save(Format format, FIBITMAP *dib, const wchar_t *filename, int flags = 0);
 
+bool SaveToMemory(Format format, FIBITMAP *dib, FIMEMORY *stream, int flags = 0);
+
+// The data is owned by the stream, and only valid until it is modified or closed
+std::string_view AcquireMemory(FIMEMORY *stream);
+
 } // namespace freeimage
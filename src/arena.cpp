@@ -0,0 +1,109 @@
+#include "arena.h"
+
+#include <algorithm>
+
+namespace
+{
+
+constexpr size_t bufferAlignment = alignof(std::max_align_t);
+
+// Larger files are partly served by the heap
+constexpr size_t maxCapacity = 32 * 1024 * 1024;
+
+// Number of files in a row that must need less than half of the buffer before it is shrunk
+constexpr uint32_t shrinkAfter = 16;
+
+} // namespace
+
+Arena::~Arena()
+{
+    for (const auto &overflow : heapBlocks)
+        upstream->deallocate(overflow.p, overflow.bytes, overflow.alignment);
+    if (buffer)
+        upstream->deallocate(buffer, capacity, bufferAlignment);
+}
+
+void Arena::reset()
+{
+    size_t needed = used + overflowBytes;
+
+    for (const auto &overflow : heapBlocks)
+        upstream->deallocate(overflow.p, overflow.bytes, overflow.alignment);
+    heapBlocks.clear();
+    overflowBytes = 0;
+    used = 0;
+
+    // Leave some room for the alignment padding
+    size_t wanted = std::min(needed + needed / 8, maxCapacity);
+
+    if (needed > capacity && capacity < maxCapacity)
+    {
+        resize(wanted);
+    }
+    else if (wanted < capacity / 2)
+    {
+        smallerNeeded = std::max(smallerNeeded, wanted);
+        if (++nbSmallerResets >= shrinkAfter)
+            resize(smallerNeeded);
+    }
+    else
+    {
+        nbSmallerResets = 0;
+        smallerNeeded = 0;
+    }
+}
+
+void Arena::resize(size_t newCapacity)
+{
+    if (buffer)
+        upstream->deallocate(buffer, capacity, bufferAlignment);
+
+    capacity = newCapacity;
+    buffer = nullptr;
+    if (capacity > 0)
+        buffer = static_cast<char *>(upstream->allocate(capacity, bufferAlignment));
+
+    nbSmallerResets = 0;
+    smallerNeeded = 0;
+}
+
+uint64_t Arena::allocations() const
+{
+    return nbAllocations;
+}
+
+uint64_t Arena::overflows() const
+{
+    return nbOverflows;
+}
+
+void *Arena::do_allocate(size_t bytes, size_t alignment)
+{
+    ++nbAllocations;
+
+    if (alignment <= bufferAlignment)
+    {
+        size_t offset = (used + alignment - 1) & ~(alignment - 1);
+        if (offset + bytes <= capacity)
+        {
+            used = offset + bytes;
+            return buffer + offset;
+        }
+    }
+
+    void *p = upstream->allocate(bytes, alignment);
+    ++nbOverflows;
+    heapBlocks.push_back({p, bytes, alignment});
+    overflowBytes += bytes + alignment;
+    return p;
+}
+
+// Memory is only given back by `reset()`
+void Arena::do_deallocate(void *, size_t, size_t)
+{
+}
+
+bool Arena::do_is_equal(const std::pmr::memory_resource &other) const noexcept
+{
+    return this == &other;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+// Memory resource for the allocations needed to convert a single file. Memory is carved out of one
+// buffer and only given back by `reset()`, after which the buffer is reused for the next file. When
+// it is too small, the overflowing allocations are served by the heap, and the buffer is enlarged
+// on the next reset, so that it quickly settles to the needs of the largest file. The buffer is
+// capped, and shrunk back once the files it was enlarged for stop coming, so that an arena kept by
+// every worker doesn't hold on to the memory of the largest file ever seen.
+class Arena : public std::pmr::memory_resource
+{
+  public:
+    Arena() = default;
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+    ~Arena() override;
+
+    void reset();
+
+    // Since the creation of the arena: all the allocations made from it, and the part of them that
+    // didn't fit in the buffer and were served by the heap
+    uint64_t allocations() const;
+    uint64_t overflows() const;
+
+  protected:
+    void *do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+  private:
+    void resize(size_t newCapacity);
+
+  private:
+    std::pmr::memory_resource *upstream = std::pmr::new_delete_resource();
+
+    char *buffer = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+
+    // Resets since the buffer was last resized that needed less than half of it, and the most any
+    // of them needed
+    uint32_t nbSmallerResets = 0;
+    size_t smallerNeeded = 0;
+
+    struct Overflow
+    {
+        void *p;
+        size_t bytes;
+        size_t alignment;
+    };
+    std::vector<Overflow> heapBlocks;
+    size_t overflowBytes = 0;
+
+    uint64_t nbAllocations = 0;
+    uint64_t nbOverflows = 0;
+};
@@ -0,0 +1,165 @@
+#include "autojobs.h"
+
+#include <algorithm>
+#include <thread>
+
+#include <fmt/core.h>
+
+namespace
+{
+
+// Long enough to average out the files of different sizes
+constexpr auto minWindow = std::chrono::seconds(3);
+
+// Throughput variations below that are considered as noise
+constexpr double tolerance = 0.05;
+
+// Weight of the last window in the throughput of the held limit
+constexpr double smoothing = 0.3;
+
+// The delay between two probes doubles after each one that didn't help, up to that many windows
+constexpr uint32_t maxProbeDelay = 16;
+
+// Below that share of I/O wait, workers beyond the number of cores only compete for the CPU
+constexpr double cpuBoundIoRatio = 0.1;
+
+} // namespace
+
+bool JobTuner::isCpuBound(double ioRatio) const
+{
+    return ioRatio < cpuBoundIoRatio && limit > std::thread::hardware_concurrency();
+}
+
+JobTuner::JobTuner(uint32_t maxJobs, uint32_t initialJobs)
+    : maxJobs(std::max(maxJobs, 1u)),
+      limit(std::clamp(initialJobs, 1u, this->maxJobs)),
+      heldLimit(limit),
+      intervalStart(Clock::now())
+{
+}
+
+void JobTuner::acquire()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this] { return active < limit; });
+    ++active;
+}
+
+void JobTuner::release(Clock::duration ioTime, Clock::duration computeTime)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    --active;
+    ++nbFiles;
+    this->ioTime += ioTime;
+    this->computeTime += computeTime;
+
+    // Wait for enough files for the throughput to be meaningful
+    auto now = Clock::now();
+    if (now - intervalStart >= minWindow && nbFiles >= 2 * limit)
+        adjust(now);
+
+    condition.notify_one();
+}
+
+void JobTuner::adjust(Clock::time_point now)
+{
+    double elapsed = std::chrono::duration<double>(now - intervalStart).count();
+    double throughput = nbFiles / elapsed;
+    double busy = std::chrono::duration<double>(ioTime + computeTime).count();
+    double ioRatio = (busy > 0.0) ? std::chrono::duration<double>(ioTime).count() / busy : 0.0;
+
+    uint32_t previousLimit = limit;
+
+    if (state == State::Probe)
+    {
+        if (throughput > heldThroughput * (1.0 + tolerance))
+        {
+            heldLimit = limit;
+            heldThroughput = throughput;
+            probeDelay = 1;
+
+            // Keep going in the same direction, unless a bound was reached
+            if ((direction > 0) ? limit < maxJobs : limit > 1)
+                startProbe(ioRatio);
+            else
+                hold();
+        }
+        else
+        {
+            limit = heldLimit;
+            probeDelay = std::min(probeDelay * 2, maxProbeDelay);
+            direction = -direction;
+            hold();
+        }
+    }
+    else
+    {
+        bool dropped = heldThroughput > 0.0 && throughput < heldThroughput * (1.0 - tolerance);
+        if (heldThroughput == 0.0 || dropped)
+        {
+            // First measurement, or the files got slower to convert: probe again soon
+            if (dropped)
+                probeDelay = 1;
+            heldThroughput = throughput;
+        }
+        else
+        {
+            heldThroughput = smoothing * throughput + (1.0 - smoothing) * heldThroughput;
+        }
+
+        // The maximum is only left when it stops paying off
+        bool canProbe = limit < maxJobs || dropped || isCpuBound(ioRatio);
+        if (++heldWindows >= probeDelay && canProbe)
+            startProbe(ioRatio);
+    }
+
+    if (limit != previousLimit)
+    {
+        fmt::println(stderr,
+                     "auto-jobs: {:.1f} files/s with {} job(s), {:.0f}% of I/O wait, now using {}",
+                     throughput,
+                     previousLimit,
+                     ioRatio * 100.0,
+                     limit);
+    }
+
+    intervalStart = now;
+    nbFiles = 0;
+    ioTime = {};
+    computeTime = {};
+
+    if (limit > previousLimit)
+        condition.notify_all();
+}
+
+void JobTuner::startProbe(double ioRatio)
+{
+    if (isCpuBound(ioRatio))
+        direction = -1;
+
+    if (direction > 0 && limit == maxJobs)
+        direction = -1;
+    else if (direction < 0 && limit == 1)
+        direction = 1;
+
+    uint32_t step = std::max(limit / 4, 1u);
+    uint32_t probeLimit = (direction > 0) ? std::min(limit + step, maxJobs)
+                                          : ((limit > step) ? limit - step : 1);
+
+    // Only one job allowed
+    if (probeLimit == limit)
+    {
+        hold();
+        return;
+    }
+
+    state = State::Probe;
+    limit = probeLimit;
+}
+
+void JobTuner::hold()
+{
+    state = State::Hold;
+    heldWindows = 0;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// Limits the number of files converted at once, and tunes that limit while the batch runs to
+// maximize the number of files converted per second. The limit is held as long as the throughput is
+// stable, and a neighbouring limit is only tried from time to time. It is kept if it does better.
+class JobTuner
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    JobTuner(uint32_t maxJobs, uint32_t initialJobs);
+
+    // Blocks until the file can be converted without exceeding the current limit
+    void acquire();
+
+    // Must be called once the file is converted, with the time spent in each stage
+    void release(Clock::duration ioTime, Clock::duration computeTime);
+
+  private:
+    enum class State
+    {
+        Hold,  // Measuring `heldLimit`
+        Probe, // Trying `limit` instead of `heldLimit`
+    };
+
+    void adjust(Clock::time_point now);
+    void startProbe(double ioRatio);
+    void hold();
+    bool isCpuBound(double ioRatio) const;
+
+  private:
+    std::mutex mutex;
+    std::condition_variable condition;
+
+    uint32_t maxJobs;
+    uint32_t limit;
+    uint32_t active = 0;
+
+    State state = State::Hold;
+    uint32_t heldLimit;
+    double heldThroughput = 0.0; // Smoothed over the windows measured with `heldLimit`
+    uint32_t heldWindows = 0;    // Since the last probe
+    uint32_t probeDelay = 1;     // Number of windows to hold before probing
+    int direction = 1;           // Of the next probe
+
+    // Measurements since the start of the window
+    Clock::time_point intervalStart;
+    uint32_t nbFiles = 0;
+    Clock::duration ioTime{};
+    Clock::duration computeTime{};
+};
@@ -1,9 +1,16 @@
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <filesystem>
 #include <memory.h>
 #include <memory>
+#include <map>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <thread>
 #include <vector>
 
@@ -16,11 +23,17 @@
 #include "blp.h"
 
 #include "FIfix.h"
+#include "arena.h"
+#include "autojobs.h"
+#include "stats.h"
+#include "tar.h"
+#include "watch.h"
 
 using blp::Header;
 using blp::Pixel;
 using std::atomic;
 using std::string;
+using std::string_view;
 using std::vector;
 using std::filesystem::path;
 using std::filesystem::u8path;
@@ -57,31 +70,254 @@ void showInfos(const path &inPath, const Header &header)
 namespace options
 {
 bool bInfos = false;
+bool bWatch = false;
 bool removeBlp = false;
 string strFormat = "png";
 uint32_t mipLevel = 0;
+bool compact = false;
 uint32_t jobs = std::thread::hardware_concurrency();
+bool autoJobs = false;
+bool orderedArchive = false;
+uint32_t shardIndex = 0;
+uint32_t shardCount = 1;
 } // namespace options
 
+uint32_t nbExpected = 0;
 atomic<uint32_t> nbImagesConverted = 0;
+atomic<uint64_t> conversionMicroseconds = 0;
+atomic<uint64_t> nbArenaAllocations = 0;
+atomic<uint64_t> nbArenaOverflows = 0;
 
-void convert(const path &inPath, const path &outPath)
+std::unique_ptr<JobTuner> jobTuner;
+std::unique_ptr<TarWriter> archive;
+
+struct Timings
 {
-    using namespace options;
+    JobTuner::Clock::duration io{};
+    JobTuner::Clock::duration compute{};
+};
+
+std::mutex failuresMutex;
+vector<stats::Failure> failures;
+
+void reportFailure(const path &inPath, const string &message)
+{
+    fmt::println(stderr, "{}: {}", inPath.u8string(), message);
+
+    // Only used for the statistics, which are never written in --watch mode
+    if (options::bWatch)
+        return;
+
+    std::lock_guard<std::mutex> lock(failuresMutex);
+    failures.push_back({inPath.u8string(), message});
+}
 
-    FILE_ptr pFile(inPath.u8string().c_str(), "rb");
+template <typename String>
+bool readFile(const path &filePath, String &data)
+{
+    FILE_ptr pFile(filePath.u8string().c_str(), "rb");
     if (!pFile)
+        return false;
+
+    fseek(pFile, 0, SEEK_END);
+    size_t size = ftell(pFile);
+    data.resize(size);
+    fseek(pFile, 0, SEEK_SET);
+    return fread(data.data(), 1, size, pFile) == size;
+}
+
+bool writeFile(const path &filePath, string_view data)
+{
+    FILE_ptr pFile(filePath.u8string().c_str(), "wb");
+    if (!pFile)
+        return false;
+
+    return fwrite(data.data(), 1, data.size(), pFile) == data.size();
+}
+
+// Writes a temporary file first (with `write(tempPath)`), so that a partially written file is never
+// visible
+template <typename Write>
+bool replaceFile(const path &filePath, Write write)
+{
+    path tempPath = filePath;
+    tempPath += ".tmp";
+
+    std::error_code ec;
+    if (write(tempPath))
+        fs::rename(tempPath, filePath, ec);
+    else
+        ec = std::make_error_code(std::errc::io_error);
+
+    if (ec)
+        fs::remove(tempPath, ec);
+    return !ec;
+}
+
+// The pixels are allocated from the arena, so the image must be saved before the arena is reset
+FIBITMAP_ptr allocateImage(Arena &arena,
+                           uint32_t width,
+                           uint32_t height,
+                           int bpp,
+                           unsigned red_mask = 0,
+                           unsigned green_mask = 0,
+                           unsigned blue_mask = 0)
+{
+    int pitch = ((width * bpp + 31) / 32) * 4;
+    auto bits = static_cast<uint8_t *>(arena.allocate(size_t(pitch) * height));
+    return FIBITMAP_ptr(bits, pitch, width, height, bpp, red_mask, green_mask, blue_mask);
+}
+
+FIBITMAP_ptr
+createImage(Arena &arena, const std::pmr::vector<Pixel> &mipmap, uint32_t width, uint32_t height)
+{
+    FIBITMAP_ptr pImage =
+        allocateImage(arena, width, height, 32, 0x000000FF, 0x0000FF00, 0x00FF0000);
+
+    for (uint32_t y = 0; y < height; ++y)
     {
-        fmt::println(stderr, "Failed to open the file `{}`", inPath.u8string());
-        return;
+        const Pixel *pixels = mipmap.data() + width * (height - y - 1);
+        uint8_t *pLine = freeimage::GetScanLine(pImage, y);
+        memcpy(pLine, pixels, width * sizeof(Pixel));
     }
-    string data;
+
+    return pImage;
+}
+
+// Paletted BLPs are kept as 8-bit indexed images (with a transparency table if needed), and images
+// without any translucent pixel are stored as 24-bit
+FIBITMAP_ptr createCompactImage(
+    Arena &arena, const Header &header, string_view data, uint32_t width, uint32_t height)
+{
+    if (auto paletted = header.getPalettedMipmap(data, options::mipLevel, &arena))
     {
-        fseek(pFile, 0, SEEK_END);
-        size_t size = ftell(pFile);
-        data.resize(size);
-        fseek(pFile, 0, SEEK_SET);
-        fread(data.data(), 1, size, pFile);
+        FIBITMAP_ptr pImage = allocateImage(arena, width, height, 8);
+
+        memcpy(freeimage::GetPalette(pImage),
+               paletted->palette.data(),
+               paletted->palette.size() * sizeof(Pixel));
+
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            uint8_t *indices = paletted->indices.data() + width * (height - y - 1);
+            uint8_t *pLine = freeimage::GetScanLine(pImage, y);
+            memcpy(pLine, indices, width);
+        }
+
+        if (paletted->hasAlpha)
+        {
+            std::pmr::vector<uint8_t> table(paletted->palette.size(), &arena);
+            for (size_t idx = 0; idx < table.size(); ++idx)
+                table[idx] = paletted->palette[idx].a;
+            freeimage::SetTransparencyTable(pImage, table.data(), int(table.size()));
+        }
+
+        return pImage;
+    }
+
+    auto mipmap = header.getMipmap(data, options::mipLevel, &arena);
+
+    bool opaque =
+        (header.alphaDepth == blp::BLP_ALPHA_DEPTH_0 &&
+         header.encoding != blp::BLP_ENCODING_UNCOMPRESSED_RAW_BGRA) ||
+        std::all_of(mipmap.begin(), mipmap.end(), [](const Pixel &p) { return p.a == 0xFF; });
+
+    if (!opaque)
+        return createImage(arena, mipmap, width, height);
+
+    FIBITMAP_ptr pImage = allocateImage(arena, width, height, 24);
+
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        const Pixel *pixels = mipmap.data() + width * (height - y - 1);
+        uint8_t *pLine = freeimage::GetScanLine(pImage, y);
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            pLine[x * 3 + 0] = pixels[x].b;
+            pLine[x * 3 + 1] = pixels[x].g;
+            pLine[x * 3 + 2] = pixels[x].r;
+        }
+    }
+
+    return pImage;
+}
+
+// The image is only encoded in memory when the time spent writing it must be measured apart, or
+// when the archive needs the bytes (returned in `archived`). Otherwise FreeImage writes the file
+// itself.
+bool saveImage(FIBITMAP *pImage, const path &outPath, Timings &timings, string &archived)
+{
+    using namespace options;
+    using Clock = JobTuner::Clock;
+
+    freeimage::Format format =
+        (strFormat == "tga" ? freeimage::Format::TARGA : freeimage::Format::PNG);
+
+    auto start = Clock::now();
+
+    if (!archive && !jobTuner)
+    {
+        auto save = [&](const path &filePath)
+        { return freeimage::Save(format, pImage, filePath.c_str()); };
+
+        bool saved = bWatch ? replaceFile(outPath, save) : save(outPath);
+        timings.compute += Clock::now() - start;
+        return saved;
+    }
+
+    FIMEMORY_ptr pMemory;
+    string_view encoded;
+    if (freeimage::SaveToMemory(format, pImage, pMemory))
+        encoded = freeimage::AcquireMemory(pMemory);
+
+    timings.compute += Clock::now() - start;
+
+    if (encoded.empty())
+        return false;
+
+    if (archive)
+    {
+        archived = encoded;
+        return true;
+    }
+
+    start = Clock::now();
+
+    bool saved;
+    if (bWatch)
+    {
+        auto write = [&](const path &filePath) { return writeFile(filePath, encoded); };
+        saved = replaceFile(outPath, write);
+    }
+    else
+    {
+        saved = writeFile(outPath, encoded);
+    }
+
+    timings.io += Clock::now() - start;
+    return saved;
+}
+
+// In archive mode, `outPath` is the path of the image in the archive, and the image is returned in
+// `archived` instead of being written. All the memory needed to decode the file is allocated from
+// the arena.
+bool convert(
+    const path &inPath, const path &outPath, Arena &arena, Timings &timings, string &archived)
+{
+    using namespace options;
+    using Clock = JobTuner::Clock;
+
+    auto start = Clock::now();
+
+    std::pmr::string data(&arena);
+    bool read = readFile(inPath, data);
+
+    timings.io += Clock::now() - start;
+
+    if (!read)
+    {
+        reportFailure(inPath, "Failed to read the file");
+        return false;
     }
 
     try
@@ -97,40 +333,414 @@ void convert(const path &inPath, const path &outPath)
         }
         else
         {
-            auto mipmap = header.getMipmap(data);
+            start = Clock::now();
 
-            FIBITMAP_ptr pImage(width, height, 32, 0x000000FF, 0x0000FF00, 0x00FF0000);
+            FIBITMAP_ptr pImage =
+                compact
+                    ? createCompactImage(arena, header, data, width, height)
+                    : createImage(arena, header.getMipmap(data, mipLevel, &arena), width, height);
 
-            for (uint32_t y = 0; y < height; ++y)
-            {
-                Pixel *data = mipmap.data() + width * (height - y - 1);
-                uint8_t *pLine = freeimage::GetScanLine(pImage, y);
-                memcpy(pLine, data, width * sizeof(Pixel));
-            }
+            timings.compute += Clock::now() - start;
+
+            bool saved = saveImage(pImage, outPath, timings, archived);
 
-            if (freeimage::Save(
-                    (strFormat == "tga" ? freeimage::Format::TARGA : freeimage::Format::PNG),
-                    pImage,
-                    outPath.c_str(),
-                    0))
+            if (saved)
             {
                 fmt::println(stderr, "{}: OK", inPath.u8string());
                 ++nbImagesConverted;
                 if (removeBlp)
                     fs::remove(inPath);
+                return true;
             }
             else
             {
-                fmt::println(stderr, "{}: Failed to save the image", inPath.u8string());
+                reportFailure(inPath, "Failed to save the image");
             }
         }
     }
     catch (const blp::BLPError &e)
     {
-        fmt::println(stderr, "{}: {}", inPath.u8string(), e.what());
+        reportFailure(inPath, e.what());
+    }
+
+    return false;
+}
+
+// Body of the tasks run by the pool
+void runConversion(const path &inPath, const path &outPath, uint64_t sequence)
+{
+    if (jobTuner)
+        jobTuner->acquire();
+
+    // Each worker reuses its arena from one file to the next
+    thread_local Arena arena;
+    uint64_t allocationsBefore = arena.allocations();
+    uint64_t overflowsBefore = arena.overflows();
+
+    Timings timings;
+    string archived;
+    bool converted = convert(inPath, outPath, arena, timings, archived);
+
+    arena.reset();
+    nbArenaAllocations += arena.allocations() - allocationsBefore;
+    nbArenaOverflows += arena.overflows() - overflowsBefore;
+
+    // An ordered archive may wait for a file that isn't converted yet, so the slot must be given
+    // back first
+    if (jobTuner)
+        jobTuner->release(timings.io, timings.compute);
+
+    if (archive && converted)
+        archive->add(sequence, outPath.generic_u8string(), std::move(archived));
+    else if (archive)
+        archive->skip(sequence);
+
+    conversionMicroseconds +=
+        std::chrono::duration_cast<std::chrono::microseconds>(timings.io + timings.compute)
+            .count();
+}
+
+void schedule(BS::thread_pool &pool, const path &inPath, const path &outPath)
+{
+    nbExpected++;
+    uint64_t sequence = archive ? archive->reserve() : 0;
+    pool.detach_task([inPath, outPath, sequence] { runConversion(inPath, outPath, sequence); });
+}
+
+// Uses a stable hash (64-bit FNV-1a) of the path of the file relative to the folder given on the
+// command line (prefixed by its name), so that independent runs on any machine agree on which
+// shard each file belongs to
+bool isInShard(const path &itemPath)
+{
+    using namespace options;
+
+    if (shardCount == 1)
+        return true;
+
+    uint64_t hash = 0xcbf29ce484222325;
+    for (char c : itemPath.generic_u8string())
+    {
+        hash ^= uint8_t(c);
+        hash *= 0x100000001b3;
+    }
+    return hash % shardCount == shardIndex;
+}
+
+bool parseShard(const string &shard)
+{
+    using namespace options;
+
+    auto slash = shard.find('/');
+    if (slash == string::npos)
+        return false;
+
+    try
+    {
+        size_t end;
+        shardIndex = std::stoul(shard.substr(0, slash), &end);
+        if (end != slash)
+            return false;
+        shardCount = std::stoul(shard.substr(slash + 1), &end);
+        if (end != shard.size() - slash - 1)
+            return false;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+
+    return shardCount > 0 && shardIndex < shardCount;
+}
+
+bool writeStats(const path &statsPath, const stats::Stats &runStats)
+{
+    return writeFile(statsPath, stats::toJson(runStats));
+}
+
+// Aggregates the `--stats-json` files written by several runs (usually one per shard)
+int mergeStats(const vector<string> &filenames, const string &u8StatsPath)
+{
+    vector<stats::Stats> runs;
+    for (const auto &filename : filenames)
+    {
+        string json;
+        if (!readFile(u8path(filename), json))
+        {
+            fmt::println(stderr, "{}: Failed to read the file", filename);
+            return 1;
+        }
+
+        try
+        {
+            runs.push_back(stats::fromJson(json));
+        }
+        catch (const std::runtime_error &e)
+        {
+            fmt::println(stderr, "{}: {}", filename, e.what());
+            return 1;
+        }
+    }
+
+    stats::Stats merged = stats::merge(runs);
+
+    try
+    {
+        stats::checkShards(merged);
+    }
+    catch (const std::runtime_error &e)
+    {
+        fmt::println(stderr, "{}", e.what());
+        return 1;
+    }
+
+    if (u8StatsPath.empty())
+    {
+        fmt::print("{}", stats::toJson(merged));
+    }
+    else if (!writeStats(u8path(u8StatsPath), merged))
+    {
+        fmt::println(stderr, "{}: Failed to write the statistics", u8StatsPath);
+        return 1;
+    }
+
+    fmt::println(stderr,
+                 "{} shard(s): {} image(s) converted, {} failed, {:.1f}s",
+                 runs.size(),
+                 merged.converted,
+                 merged.expected - merged.converted,
+                 merged.elapsed);
+
+    return (merged.converted < merged.expected) ? 1 : 0;
+}
+
+void createDirectories(const path &dirPath)
+{
+    if (!archive)
+        fs::create_directories(dirPath);
+}
+
+bool isBlpFile(const path &filePath)
+{
+    string extension = filePath.extension().u8string();
+    return extension == ".blp" || extension == ".BLP";
+}
+
+path outputFilePath(const path &outDirPath, const path &itemInPath)
+{
+    return outDirPath / path{itemInPath}.replace_extension(options::strFormat);
+}
+
+// In --watch mode, each file has at most one conversion queued or running. A change arriving
+// meanwhile marks it as dirty, so that it is converted again once done. Renames and removals
+// update the conversion, which looks up its paths when it starts.
+struct WatchedConversion
+{
+    path inPath;
+    path outPath;
+    bool dirty = false;
+    bool removed = false;
+};
+
+std::mutex watchedMutex;
+std::map<path, std::shared_ptr<WatchedConversion>> watchedConversions; // By input path
+
+void runWatchedConversion(BS::thread_pool &pool, std::shared_ptr<WatchedConversion> conversion)
+{
+    std::unique_lock<std::mutex> lock(watchedMutex);
+    path inPath = conversion->inPath;
+    path outPath = conversion->outPath;
+    bool removed = conversion->removed;
+    conversion->dirty = false;
+    lock.unlock();
+
+    if (!removed)
+        runConversion(inPath, outPath, 0);
+
+    lock.lock();
+
+    // The file was renamed or removed while being converted: the image is stale
+    bool moved = (conversion->inPath != inPath);
+    if (moved || conversion->removed)
+    {
+        std::error_code ec;
+        fs::remove(outPath, ec);
+    }
+
+    if (!conversion->removed && (moved || conversion->dirty))
+    {
+        pool.detach_task([&pool, conversion] { runWatchedConversion(pool, conversion); });
+    }
+    else
+    {
+        auto it = watchedConversions.find(conversion->inPath);
+        if (it != watchedConversions.end() && it->second == conversion)
+            watchedConversions.erase(it);
     }
 }
 
+bool isWithin(const path &filePath, const path &dirPath)
+{
+    path rest = filePath.lexically_relative(dirPath);
+    return !rest.empty() && *rest.begin() != "..";
+}
+
+path rebase(const path &filePath, const path &fromDirPath, const path &toDirPath)
+{
+    path rest = filePath.lexically_relative(fromDirPath);
+    return (rest == ".") ? toDirPath : toDirPath / rest;
+}
+
+void scheduleWatched(BS::thread_pool &pool, const path &inPath, const path &outPath)
+{
+    std::lock_guard<std::mutex> lock(watchedMutex);
+
+    auto &conversion = watchedConversions[inPath];
+    if (conversion)
+    {
+        conversion->dirty = true;
+        return;
+    }
+
+    conversion = std::make_shared<WatchedConversion>();
+    conversion->inPath = inPath;
+    conversion->outPath = outPath;
+    pool.detach_task([&pool, conversion] { runWatchedConversion(pool, conversion); });
+}
+
+// Returns whether any conversion was affected
+bool moveWatched(const path &fromInPath,
+                 const path &toInPath,
+                 const path &fromOutPath,
+                 const path &toOutPath)
+{
+    std::lock_guard<std::mutex> lock(watchedMutex);
+
+    vector<std::shared_ptr<WatchedConversion>> moved;
+    for (auto it = watchedConversions.begin(); it != watchedConversions.end();)
+    {
+        if (isWithin(it->first, fromInPath))
+        {
+            moved.push_back(it->second);
+            it = watchedConversions.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    for (auto &conversion : moved)
+    {
+        conversion->inPath = rebase(conversion->inPath, fromInPath, toInPath);
+        conversion->outPath = rebase(conversion->outPath, fromOutPath, toOutPath);
+
+        auto &entry = watchedConversions[conversion->inPath];
+        if (entry)
+            entry->removed = true;
+        entry = conversion;
+    }
+
+    return !moved.empty();
+}
+
+void removeWatched(const path &inPath)
+{
+    std::lock_guard<std::mutex> lock(watchedMutex);
+
+    for (auto it = watchedConversions.begin(); it != watchedConversions.end();)
+    {
+        if (isWithin(it->first, inPath))
+        {
+            it->second->removed = true;
+            it = watchedConversions.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+// Mirrors the changes made in the input folders into the output ones, until an error occurs
+void watchFolders(BS::thread_pool &pool, const vector<path> &inDirs, const vector<path> &outDirs)
+{
+    watch::Handler handler;
+
+    handler.changed = [&](size_t root, const path &itemInPath)
+    {
+        if (!isBlpFile(itemInPath))
+            return;
+
+        path fullInPath = inDirs[root] / itemInPath;
+        path fullOutPath = outputFilePath(outDirs[root], itemInPath);
+
+        std::error_code ec;
+        fs::create_directories(fullOutPath.parent_path(), ec);
+        if (ec)
+        {
+            fmt::println(stderr, "{}: {}", fullOutPath.parent_path().u8string(), ec.message());
+            return;
+        }
+
+        scheduleWatched(pool, fullInPath, fullOutPath);
+    };
+
+    handler.removed = [&](size_t root, const path &itemInPath, bool isDirectory)
+    {
+        removeWatched(inDirs[root] / itemInPath);
+
+        std::error_code ec;
+        if (isDirectory)
+            fs::remove_all(outDirs[root] / itemInPath, ec);
+        else if (isBlpFile(itemInPath))
+            fs::remove(outputFilePath(outDirs[root], itemInPath), ec);
+
+        if (ec)
+            fmt::println(stderr, "{}: {}", (inDirs[root] / itemInPath).u8string(), ec.message());
+    };
+
+    handler.moved = [&](size_t root, const path &fromInPath, const path &toInPath, bool isDirectory)
+    {
+        std::error_code ec;
+        if (isDirectory || (isBlpFile(fromInPath) && isBlpFile(toInPath)))
+        {
+            path fromOutPath = isDirectory ? outDirs[root] / fromInPath
+                                           : outputFilePath(outDirs[root], fromInPath);
+            path toOutPath = isDirectory ? outDirs[root] / toInPath
+                                         : outputFilePath(outDirs[root], toInPath);
+
+            // Queued conversions will use the new paths
+            bool converting = moveWatched(
+                inDirs[root] / fromInPath, inDirs[root] / toInPath, fromOutPath, toOutPath);
+
+            if (!fs::exists(fromOutPath, ec))
+            {
+                if (!isDirectory && !converting)
+                    handler.changed(root, toInPath);
+                return;
+            }
+
+            fs::create_directories(toOutPath.parent_path(), ec);
+            if (!ec)
+                fs::rename(fromOutPath, toOutPath, ec);
+        }
+        else if (isBlpFile(fromInPath))
+        {
+            removeWatched(inDirs[root] / fromInPath);
+            fs::remove(outputFilePath(outDirs[root], fromInPath), ec);
+        }
+        else
+        {
+            handler.changed(root, toInPath);
+        }
+
+        if (ec)
+            fmt::println(stderr, "{}: {}", (inDirs[root] / toInPath).u8string(), ec.message());
+    };
+
+    watch::run(inDirs, handler);
+}
+
 int main(int argc, char **argv)
 {
     using namespace options;
@@ -140,32 +750,105 @@ int main(int argc, char **argv)
     CLI::App app{"Convert BLP image files to PNG or TGA format", "BLPConverter"};
 
     string u8OutputDirName = "./";
+    string u8Shard;
+    string u8StatsJsonPath;
+    string u8ArchivePath;
+    bool bMergeStats = false;
     vector<string> filenames;
 
     app.add_flag(
         "-i,--infos", bInfos, "Display informations about the BLP file(s) (no conversion)");
-    app.add_flag("--rm", removeBlp, "Remove the original BLP file after conversion");
+    auto rmFlag =
+        app.add_flag("--rm", removeBlp, "Remove the original BLP file after conversion");
     app.add_option(
            "-o,--dest", u8OutputDirName, "Folder where the converted image(s) must be written to")
         ->capture_default_str();
     app.add_option("-f,--format", strFormat, "`png` or `tga`")->capture_default_str();
     app.add_option("-m,--miplevel", mipLevel, "The specific mip level to convert")
         ->capture_default_str();
+    app.add_flag("--compact",
+                 compact,
+                 "Write paletted BLPs as indexed images and drop the alpha channel when unused");
     app.add_option("-j,--jobs", jobs, "Number of parallel jobs")->capture_default_str();
+    app.add_flag("--auto-jobs",
+                 autoJobs,
+                 "Tune the number of parallel jobs while converting (`-j` is then the maximum)");
+    auto watchFlag = app.add_flag("--watch",
+                 bWatch,
+                 "Keep converting the BLP files created or modified in the folder(s)")
+        ->excludes(rmFlag);
+    auto archiveOption =
+        app.add_option("--output-archive",
+                       u8ArchivePath,
+                       "Tar archive where the converted image(s) must be written to, instead of -o")
+            ->excludes(rmFlag)
+            ->excludes(watchFlag);
+    app.add_flag("--ordered-archive",
+                 orderedArchive,
+                 "Write the images in the archive in a deterministic order (sorted by path)")
+        ->needs(archiveOption);
+    app.add_option("--shard",
+                   u8Shard,
+                   "Only convert the i-th of N deterministic parts of the files (`i/N`, i < N)")
+        ->excludes(watchFlag);
+    app.add_option(
+           "--stats-json", u8StatsJsonPath, "File where statistics about the run are written to")
+        ->excludes(watchFlag);
+    app.add_flag("--merge-stats",
+                 bMergeStats,
+                 "Merge the `--stats-json` files given instead of BLP files (no conversion)")
+        ->excludes(watchFlag);
     app.add_option("files", filenames)->expected(1, -1)->required();
 
     CLI11_PARSE(app, argc, argv);
 
-    path outputPath = u8path(u8OutputDirName);
+    if (bMergeStats)
+        return mergeStats(filenames, u8StatsJsonPath);
+
+    if (!u8Shard.empty() && !parseShard(u8Shard))
+    {
+        fmt::println(stderr, "Invalid shard `{}`: expected `i/N` with i < N", u8Shard);
+        return 1;
+    }
+
+    // Output paths are relative to the root of the archive
+    path outputPath = u8ArchivePath.empty() ? u8path(u8OutputDirName) : path();
 
-    if (jobs == 0)
+    if (autoJobs && app.count("--jobs") == 0)
+        jobs = 4 * std::thread::hardware_concurrency();
+    else if (jobs == 0)
         jobs = std::thread::hardware_concurrency();
 
+    if (autoJobs)
+        jobTuner = std::make_unique<JobTuner>(jobs, std::thread::hardware_concurrency());
+
+    if (bWatch && !watch::isSupported())
+    {
+        fmt::println(stderr, "--watch is not supported on this platform");
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    if (!u8ArchivePath.empty())
+    {
+        try
+        {
+            archive = std::make_unique<TarWriter>(u8path(u8ArchivePath), orderedArchive);
+        }
+        catch (const std::system_error &e)
+        {
+            fmt::println(stderr, "{}", e.what());
+            return 1;
+        }
+    }
+
     freeimage::Initialise(true);
 
     BS::thread_pool pool(jobs);
 
-    uint32_t nbExpected = 0;
+    vector<path> watchedInDirs;
+    vector<path> watchedOutDirs;
 
     for (const auto &filename : filenames)
     {
@@ -189,7 +872,27 @@ int main(int argc, char **argv)
                     groupInDirPath = groupInDirPath.parent_path();
 
                 path groupOutDirPath = outputPath / groupInDirPath.filename();
-                fs::create_directories(groupOutDirPath);
+                createDirectories(groupOutDirPath);
+
+                // The watcher reports the files already in the folder as changed
+                if (bWatch)
+                {
+                    watchedInDirs.push_back(fileEntry.path());
+                    watchedOutDirs.push_back(groupOutDirPath);
+                    continue;
+                }
+
+                auto scheduleItem = [&](const path &itemInPath)
+                {
+                    path fullInPath = fileEntry.path() / itemInPath;
+                    path fullOutPath = outputFilePath(groupOutDirPath, itemInPath);
+                    createDirectories(fullOutPath.parent_path());
+
+                    schedule(pool, fullInPath, fullOutPath);
+                };
+
+                // The order of the directory iterator depends on the filesystem
+                vector<path> sortedItems;
 
                 fs::recursive_directory_iterator it(fileEntry), end;
                 for (; it != end; ++it)
@@ -197,37 +900,41 @@ int main(int argc, char **argv)
                     if (!it->is_regular_file())
                         continue;
 
-                    string extension = it->path().extension().u8string();
-                    if (extension == ".blp" || extension == ".BLP")
+                    if (isBlpFile(it->path()))
                     {
-                        path fullInPath = it->path();
                         path itemInPath = fs::relative(it->path(), fileEntry.path());
-                        path itemOutPath = path{itemInPath}.replace_extension(strFormat);
-                        path fullOutPath = groupOutDirPath / itemOutPath;
-                        fs::create_directories(fullOutPath.parent_path());
+                        if (!isInShard(groupInDirPath.filename() / itemInPath))
+                            continue;
 
-                        nbExpected++;
-                        pool.detach_task([fullInPath, fullOutPath]
-                                         { convert(fullInPath, fullOutPath); });
+                        if (orderedArchive)
+                            sortedItems.push_back(itemInPath);
+                        else
+                            scheduleItem(itemInPath);
                     }
                 }
+
+                std::sort(sortedItems.begin(), sortedItems.end());
+                for (const auto &itemInPath : sortedItems)
+                    scheduleItem(itemInPath);
+            }
+            else if (!isInShard(filePath.filename()))
+            {
+                continue;
             }
             else if (fileEntry.is_regular_file())
             {
-                fs::create_directories(outputPath);
+                createDirectories(outputPath);
 
                 path filePath = u8path(filename);
                 path itemOutPath = filePath.filename().replace_extension(strFormat);
                 path fullOutPath = outputPath / itemOutPath;
 
-                nbExpected++;
-                pool.detach_task([filePath, fullOutPath] { convert(filePath, fullOutPath); });
+                schedule(pool, filePath, fullOutPath);
             }
             else
             {
                 nbExpected++;
-                fmt::println(
-                    stderr, "{}: Not a directory or a regular file", fileEntry.path().u8string());
+                reportFailure(fileEntry.path(), "Not a directory or a regular file");
                 continue;
             }
         }
@@ -238,11 +945,53 @@ int main(int argc, char **argv)
         }
     }
 
+    if (bWatch && watchedInDirs.empty())
+    {
+        fmt::println(stderr, "No folder to watch");
+    }
+    else if (bWatch)
+    {
+        try
+        {
+            watchFolders(pool, watchedInDirs, watchedOutDirs);
+        }
+        catch (const std::system_error &e)
+        {
+            fmt::println(stderr, "{}", e.what());
+            return 1;
+        }
+    }
+
     pool.wait();
 
     freeimage::DeInitialise();
 
-    if (nbImagesConverted < nbExpected)
+    bool archiveFailed = archive && !archive->finish();
+    if (archiveFailed)
+        fmt::println(stderr, "{}: Failed to write the archive", u8ArchivePath);
+
+    if (!u8StatsJsonPath.empty())
+    {
+        stats::Stats runStats;
+        runStats.shards.push_back(fmt::format("{}/{}", shardIndex, shardCount));
+        runStats.expected = nbExpected;
+        runStats.converted = nbImagesConverted;
+        runStats.elapsed =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        runStats.conversionTime = conversionMicroseconds / 1e6;
+        runStats.arenaAllocations = nbArenaAllocations;
+        runStats.arenaOverflows = nbArenaOverflows;
+        runStats.failures = failures;
+
+        if (!writeStats(u8path(u8StatsJsonPath), runStats))
+            fmt::println(stderr, "{}: Failed to write the statistics", u8StatsJsonPath);
+    }
+
+    if (archiveFailed)
+    {
+        return 1;
+    }
+    else if (nbImagesConverted < nbExpected)
     {
         fmt::println(stderr, "Failed to convert {} image(s)", nbExpected - nbImagesConverted);
         return 1;
@@ -0,0 +1,123 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+
+using nlohmann::json;
+using std::string;
+using std::vector;
+
+namespace stats
+{
+
+string toJson(const Stats &stats)
+{
+    auto perFile = [&](uint64_t count)
+    { return stats.expected ? double(count) / stats.expected : 0.0; };
+
+    json failures = json::array();
+    for (const auto &failure : stats.failures)
+        failures.push_back({{"file", failure.file}, {"error", failure.error}});
+
+    json result = {
+        {"shards", stats.shards},
+        {"expected", stats.expected},
+        {"converted", stats.converted},
+        {"failed", stats.expected - stats.converted},
+        {"elapsed", stats.elapsed},
+        {"conversionTime", stats.conversionTime},
+        {"arenaAllocations", stats.arenaAllocations},
+        {"arenaOverflows", stats.arenaOverflows},
+        {"arenaAllocationsPerFile", perFile(stats.arenaAllocations)},
+        {"arenaOverflowsPerFile", perFile(stats.arenaOverflows)},
+        {"failures", failures},
+    };
+    return result.dump(2) + "\n";
+}
+
+Stats fromJson(const string &text)
+{
+    try
+    {
+        json value = json::parse(text);
+
+        Stats stats;
+        value.at("shards").get_to(stats.shards);
+        value.at("expected").get_to(stats.expected);
+        value.at("converted").get_to(stats.converted);
+        value.at("elapsed").get_to(stats.elapsed);
+        value.at("conversionTime").get_to(stats.conversionTime);
+        stats.arenaAllocations = value.value("arenaAllocations", uint64_t(0));
+        stats.arenaOverflows = value.value("arenaOverflows", uint64_t(0));
+        for (const auto &failure : value.at("failures"))
+            stats.failures.push_back({failure.at("file"), failure.at("error")});
+        return stats;
+    }
+    catch (const json::exception &e)
+    {
+        throw std::runtime_error(e.what());
+    }
+}
+
+Stats merge(const vector<Stats> &runs)
+{
+    Stats result;
+    for (const auto &run : runs)
+    {
+        result.shards.insert(result.shards.end(), run.shards.begin(), run.shards.end());
+        result.expected += run.expected;
+        result.converted += run.converted;
+        result.elapsed = std::max(result.elapsed, run.elapsed);
+        result.conversionTime += run.conversionTime;
+        result.arenaAllocations += run.arenaAllocations;
+        result.arenaOverflows += run.arenaOverflows;
+        result.failures.insert(result.failures.end(), run.failures.begin(), run.failures.end());
+    }
+    return result;
+}
+
+void checkShards(const Stats &merged)
+{
+    if (merged.shards.empty())
+        throw std::runtime_error("No shard to merge");
+
+    uint32_t count = 0;
+    vector<uint32_t> seen;
+    for (const auto &shard : merged.shards)
+    {
+        unsigned index = 0, shardCount = 0;
+        char end;
+        if (sscanf(shard.c_str(), "%u/%u%c", &index, &shardCount, &end) != 2 || shardCount == 0 ||
+            index >= shardCount)
+            throw std::runtime_error(fmt::format("Invalid shard `{}`", shard));
+
+        if (count == 0)
+        {
+            count = shardCount;
+            seen.assign(count, 0);
+        }
+        else if (shardCount != count)
+        {
+            throw std::runtime_error(
+                fmt::format("Shards of different counts: `{}` and `{}`", merged.shards[0], shard));
+        }
+
+        if (++seen[index] > 1)
+            throw std::runtime_error(fmt::format("Shard `{}` is given more than once", shard));
+    }
+
+    string missing;
+    for (uint32_t index = 0; index < count; ++index)
+    {
+        if (seen[index] == 0)
+            missing += fmt::format("{}{}/{}", missing.empty() ? "" : ", ", index, count);
+    }
+    if (!missing.empty())
+        throw std::runtime_error("Missing shard(s): " + missing);
+}
+
+} // namespace stats
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace stats
+{
+
+struct Failure
+{
+    std::string file;
+    std::string error;
+};
+
+struct Stats
+{
+    std::vector<std::string> shards; // `i/N` of each run (`0/1` if not sharded)
+    uint32_t expected = 0;
+    uint32_t converted = 0;
+    double elapsed = 0.0;          // Wall-clock seconds, the longest of the merged runs
+    double conversionTime = 0.0;   // Seconds spent converting, summed over all the files
+    uint64_t arenaAllocations = 0; // Made from the worker arenas while decoding the files
+    uint64_t arenaOverflows = 0;   // The part of them that didn't fit, and were served by the heap
+
+    // The other heap allocations are not counted: the encoded images, FreeImage's memory streams
+    // and bitmap headers, and the allocations made by the encoders
+    std::vector<Failure> failures;
+};
+
+std::string toJson(const Stats &stats);
+
+// Throws std::runtime_error if the JSON is malformed
+Stats fromJson(const std::string &json);
+
+Stats merge(const std::vector<Stats> &runs);
+
+// Throws std::runtime_error unless the shards are exactly `0/N` to `N-1/N`, for a single N
+void checkShards(const Stats &merged);
+
+} // namespace stats
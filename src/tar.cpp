@@ -0,0 +1,217 @@
+#include "tar.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string_view>
+#include <ctime>
+#include <system_error>
+
+#include <fmt/core.h>
+#include <nowide/cstdio.hpp>
+
+using std::string;
+
+namespace
+{
+
+constexpr size_t blockSize = 512;
+constexpr size_t bufferSize = 4 * 1024 * 1024;
+constexpr size_t maxQueuedBytes = 256 * 1024 * 1024;
+
+// POSIX ustar header
+struct Header
+{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char type;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+};
+
+static_assert(sizeof(Header) == blockSize);
+
+// Returns where the name must be split between the `prefix` and `name` fields of the header (0 if
+// it fits in `name`), or nothing if it can't be stored in a ustar header
+std::optional<size_t> ustarSplit(const string &name)
+{
+    if (name.size() <= sizeof(Header::name))
+        return 0;
+
+    auto slash = name.find('/', name.size() - sizeof(Header::name) - 1);
+    if (slash == string::npos || slash == 0 || slash > sizeof(Header::prefix))
+        return std::nullopt;
+    return slash;
+}
+
+template <size_t N>
+void writeOctal(char (&field)[N], uint64_t value)
+{
+    fmt::format_to_n(field, N - 1, "{:0{}o}", value, N - 1);
+}
+
+} // namespace
+
+TarWriter::TarWriter(const std::filesystem::path &archivePath, bool ordered)
+    : pFile(nowide::fopen(archivePath.u8string().c_str(), "wb")),
+      ordered(ordered)
+{
+    if (!pFile)
+        throw std::system_error(errno, std::generic_category(), archivePath.u8string());
+
+    buffer.reserve(bufferSize + blockSize);
+    writer = std::thread(&TarWriter::run, this);
+}
+
+TarWriter::~TarWriter()
+{
+    if (writer.joinable())
+        finish();
+}
+
+uint64_t TarWriter::reserve()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return nextReserved++;
+}
+
+void TarWriter::add(uint64_t sequence, string name, string data)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // The next file to write must never wait, or nothing could ever be written in ordered mode
+    condition.wait(lock,
+                   [&] { return queuedBytes < maxQueuedBytes || sequence == nextSequence; });
+
+    queuedBytes += data.size();
+    pending.emplace(sequence, Entry{std::move(name), std::move(data)});
+    condition.notify_all();
+}
+
+void TarWriter::skip(uint64_t sequence)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.emplace(sequence, std::nullopt);
+    condition.notify_all();
+}
+
+bool TarWriter::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finishing = true;
+        condition.notify_all();
+    }
+    writer.join();
+
+    // End of archive: two empty blocks
+    char zeros[2 * blockSize] = {};
+    append(zeros, sizeof(zeros));
+    flush();
+
+    failed |= (fclose(pFile) != 0);
+    return !failed;
+}
+
+bool TarWriter::isReady() const
+{
+    if (pending.empty())
+        return false;
+    return !ordered || pending.begin()->first == nextSequence;
+}
+
+void TarWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        condition.wait(lock, [this] { return finishing || isReady(); });
+        if (!isReady())
+            break;
+
+        auto node = pending.extract(pending.begin());
+        nextSequence = node.key() + 1;
+
+        lock.unlock();
+        if (node.mapped())
+            writeEntry(*node.mapped());
+        lock.lock();
+
+        if (node.mapped())
+            queuedBytes -= node.mapped()->data.size();
+        condition.notify_all();
+    }
+}
+
+void TarWriter::writeEntry(const Entry &entry)
+{
+    // Names too long for the ustar header are given in a preceding GNU long name entry
+    if (!ustarSplit(entry.name))
+    {
+        writeHeader("././@LongLink", entry.name.size() + 1, 'L');
+        append(entry.name.c_str(), entry.name.size() + 1);
+    }
+
+    writeHeader(entry.name, entry.data.size(), '0');
+    append(entry.data.data(), entry.data.size());
+}
+
+void TarWriter::writeHeader(const string &name, uint64_t size, char type)
+{
+    Header header = {};
+
+    std::string_view shortName = name;
+    size_t split = ustarSplit(name).value_or(0);
+    if (split > 0)
+    {
+        memcpy(header.prefix, name.data(), split);
+        shortName.remove_prefix(split + 1);
+    }
+    memcpy(header.name, shortName.data(), std::min(shortName.size(), sizeof(header.name)));
+
+    writeOctal(header.mode, 0644);
+    writeOctal(header.uid, 0);
+    writeOctal(header.gid, 0);
+    writeOctal(header.size, size);
+    writeOctal(header.mtime, uint64_t(time(nullptr)));
+    header.type = type;
+    memcpy(header.magic, "ustar", 6);
+    memcpy(header.version, "00", 2);
+
+    memset(header.checksum, ' ', sizeof(header.checksum));
+    unsigned checksum = 0;
+    for (size_t idx = 0; idx < sizeof(Header); ++idx)
+        checksum += reinterpret_cast<const uint8_t *>(&header)[idx];
+    writeOctal(header.checksum, checksum);
+
+    append(reinterpret_cast<const char *>(&header), sizeof(Header));
+}
+
+// Adds the data to the buffer, padded to a whole number of blocks
+void TarWriter::append(const char *data, size_t size)
+{
+    buffer.append(data, size);
+    buffer.append((blockSize - size % blockSize) % blockSize, '\0');
+
+    if (buffer.size() >= bufferSize)
+        flush();
+}
+
+void TarWriter::flush()
+{
+    if (!buffer.empty() && fwrite(buffer.data(), 1, buffer.size(), pFile) != buffer.size())
+        failed = true;
+    buffer.clear();
+}
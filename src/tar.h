@@ -0,0 +1,65 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+// Appends files to a tar archive from a dedicated thread, so that workers only hand over the
+// encoded data. Each file is identified by a sequence number obtained from `reserve()`; in ordered
+// mode, files are written by increasing sequence numbers whatever order they are completed in.
+class TarWriter
+{
+  public:
+    // Throws std::system_error if the archive can't be created
+    TarWriter(const std::filesystem::path &archivePath, bool ordered);
+    ~TarWriter();
+
+    uint64_t reserve();
+
+    // Blocks while too much data is waiting to be written
+    void add(uint64_t sequence, std::string name, std::string data);
+
+    // Must be called instead of `add()` for the files that could not be converted
+    void skip(uint64_t sequence);
+
+    // Writes the end of the archive and closes it, returns false if any write failed
+    bool finish();
+
+  private:
+    struct Entry
+    {
+        std::string name;
+        std::string data;
+    };
+
+    bool isReady() const;
+    void run();
+    void writeEntry(const Entry &entry);
+    void writeHeader(const std::string &name, uint64_t size, char type);
+    void append(const char *data, size_t size);
+    void flush();
+
+  private:
+    FILE *pFile;
+    bool ordered;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::map<uint64_t, std::optional<Entry>> pending;
+    uint64_t nextReserved = 0;
+    uint64_t nextSequence = 0;
+    size_t queuedBytes = 0;
+    bool finishing = false;
+
+    // Only used by the writer thread
+    std::string buffer;
+    bool failed = false;
+
+    std::thread writer;
+};
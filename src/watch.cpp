@@ -0,0 +1,366 @@
+#include "watch.h"
+
+#include <system_error>
+
+#ifdef __linux__
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <map>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+#include <fmt/core.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using std::size_t;
+using std::vector;
+using std::filesystem::path;
+
+namespace fs = std::filesystem;
+
+namespace watch
+{
+
+#ifdef __linux__
+
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+constexpr uint32_t watchMask = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM |
+                               IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+bool isWithin(const path &relPath, const path &relDir)
+{
+    return std::mismatch(relDir.begin(), relDir.end(), relPath.begin(), relPath.end()).first ==
+           relDir.end();
+}
+
+path rebase(const path &relPath, const path &fromRelDir, const path &toRelDir)
+{
+    path rest = relPath.lexically_relative(fromRelDir);
+    return (rest == ".") ? toRelDir : toRelDir / rest;
+}
+
+class Watcher
+{
+  public:
+    Watcher(const vector<path> &roots, const Handler &handler)
+        : roots(roots),
+          handler(handler)
+    {
+        fd = inotify_init1(IN_CLOEXEC);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "inotify_init1");
+    }
+
+    ~Watcher()
+    {
+        close(fd);
+    }
+
+    void run()
+    {
+        for (size_t root = 0; root < roots.size(); ++root)
+            addTree(root, path());
+
+        for (;;)
+        {
+            pollfd pfd{fd, POLLIN, 0};
+            if (poll(&pfd, 1, timeout()) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "poll");
+            }
+
+            if (pfd.revents & POLLIN)
+                readEvents();
+
+            flushSettled();
+        }
+    }
+
+  private:
+    struct Directory
+    {
+        size_t root;
+        path relPath;
+    };
+
+    struct MoveFrom
+    {
+        uint32_t cookie;
+        size_t root;
+        path relPath;
+        bool isDirectory;
+    };
+
+    using Key = std::pair<size_t, path>;
+
+    int timeout() const
+    {
+        if (pending.empty())
+            return -1;
+
+        auto deadline =
+            std::min_element(pending.begin(),
+                             pending.end(),
+                             [](const auto &a, const auto &b) { return a.second < b.second; })
+                ->second;
+
+        auto remaining =
+            std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        return int(std::max<decltype(remaining)>(remaining, 0) + 1);
+    }
+
+    void touch(size_t root, const path &relPath)
+    {
+        pending[{root, relPath}] = Clock::now() + std::chrono::milliseconds(settleDelay);
+    }
+
+    void flushSettled()
+    {
+        auto now = Clock::now();
+        for (auto it = pending.begin(); it != pending.end();)
+        {
+            if (it->second <= now)
+            {
+                handler.changed(it->first.first, it->first.second);
+                it = pending.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    // Watches the directory and its subdirectories. Files found in them are considered as changed,
+    // since they may have been written before the watch was in place.
+    void addTree(size_t root, const path &relDir)
+    {
+        path dirPath = roots[root] / relDir;
+
+        int wd = inotify_add_watch(fd, dirPath.c_str(), watchMask);
+        if (wd < 0)
+        {
+            fmt::println(stderr,
+                         "{}: Failed to watch the directory ({})",
+                         dirPath.u8string(),
+                         std::system_category().message(errno));
+            return;
+        }
+        directories[wd] = Directory{root, relDir};
+
+        std::error_code ec;
+        for (const auto &entry : fs::directory_iterator(dirPath, ec))
+        {
+            path relPath = relDir / entry.path().filename();
+            if (entry.is_directory(ec) && !entry.is_symlink(ec))
+                addTree(root, relPath);
+            else if (entry.is_regular_file(ec))
+                touch(root, relPath);
+        }
+    }
+
+    // Stops watching a tree that was deleted or moved out of the root
+    void forgetTree(size_t root, const path &relPath, bool isDirectory)
+    {
+        for (auto it = pending.begin(); it != pending.end();)
+        {
+            if (it->first.first == root && isWithin(it->first.second, relPath))
+                it = pending.erase(it);
+            else
+                ++it;
+        }
+
+        if (isDirectory)
+        {
+            for (auto it = directories.begin(); it != directories.end();)
+            {
+                if (it->second.root == root && isWithin(it->second.relPath, relPath))
+                {
+                    inotify_rm_watch(fd, it->first);
+                    it = directories.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+
+        handler.removed(root, relPath, isDirectory);
+    }
+
+    void renameTree(size_t root, const path &fromRelPath, const path &toRelPath, bool isDirectory)
+    {
+        std::map<Key, Clock::time_point> renamed;
+        for (auto it = pending.begin(); it != pending.end();)
+        {
+            if (it->first.first == root && isWithin(it->first.second, fromRelPath))
+            {
+                renamed[{root, rebase(it->first.second, fromRelPath, toRelPath)}] = it->second;
+                it = pending.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        pending.merge(renamed);
+
+        if (isDirectory)
+        {
+            for (auto &[wd, directory] : directories)
+            {
+                if (directory.root == root && isWithin(directory.relPath, fromRelPath))
+                    directory.relPath = rebase(directory.relPath, fromRelPath, toRelPath);
+            }
+        }
+
+        handler.moved(root, fromRelPath, toRelPath, isDirectory);
+    }
+
+    void flushMoveFrom()
+    {
+        if (moveFrom)
+        {
+            forgetTree(moveFrom->root, moveFrom->relPath, moveFrom->isDirectory);
+            moveFrom.reset();
+        }
+    }
+
+    void readEvents()
+    {
+        alignas(inotify_event) char buffer[64 * 1024];
+
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                return;
+            throw std::system_error(errno, std::generic_category(), "read");
+        }
+
+        for (char *ptr = buffer; ptr < buffer + length;)
+        {
+            auto event = reinterpret_cast<const inotify_event *>(ptr);
+            ptr += sizeof(inotify_event) + event->len;
+            handleEvent(*event);
+        }
+
+        // The matching IN_MOVED_TO would have been in the same batch if the item had stayed in
+        // the watched trees
+        flushMoveFrom();
+    }
+
+    void handleEvent(const inotify_event &event)
+    {
+        if (event.mask & IN_Q_OVERFLOW)
+        {
+            fmt::println(stderr, "Too many changes at once, rescanning the watched folders");
+            flushMoveFrom();
+            for (const auto &[wd, directory] : directories)
+                inotify_rm_watch(fd, wd);
+            directories.clear();
+            for (size_t root = 0; root < roots.size(); ++root)
+                addTree(root, path());
+            return;
+        }
+
+        auto it = directories.find(event.wd);
+        if (it == directories.end())
+            return;
+
+        if (event.mask & IN_IGNORED)
+        {
+            directories.erase(it);
+            return;
+        }
+
+        size_t root = it->second.root;
+        path relPath = it->second.relPath / path(event.name);
+        bool isDirectory = event.mask & IN_ISDIR;
+
+        if (!(event.mask & IN_MOVED_TO))
+            flushMoveFrom();
+
+        if (event.mask & IN_MOVED_FROM)
+        {
+            moveFrom = MoveFrom{event.cookie, root, relPath, isDirectory};
+        }
+        else if (event.mask & IN_MOVED_TO)
+        {
+            if (moveFrom && moveFrom->cookie == event.cookie && moveFrom->root == root)
+            {
+                renameTree(root, moveFrom->relPath, relPath, isDirectory);
+                moveFrom.reset();
+                return;
+            }
+
+            flushMoveFrom();
+            if (isDirectory)
+                addTree(root, relPath);
+            else
+                touch(root, relPath);
+        }
+        else if (event.mask & IN_DELETE)
+        {
+            forgetTree(root, relPath, isDirectory);
+        }
+        else if (isDirectory)
+        {
+            if (event.mask & IN_CREATE)
+                addTree(root, relPath);
+        }
+        else
+        {
+            touch(root, relPath);
+        }
+    }
+
+  private:
+    int fd;
+    const vector<path> &roots;
+    const Handler &handler;
+    std::unordered_map<int, Directory> directories;
+    std::map<Key, Clock::time_point> pending;
+    std::optional<MoveFrom> moveFrom;
+};
+
+} // namespace
+
+bool isSupported()
+{
+    return true;
+}
+
+void run(const vector<path> &roots, const Handler &handler)
+{
+    Watcher(roots, handler).run();
+}
+
+#else
+
+bool isSupported()
+{
+    return false;
+}
+
+void run(const vector<path> &, const Handler &)
+{
+    throw std::system_error(std::make_error_code(std::errc::function_not_supported),
+                            "Watching folders is only supported on Linux");
+}
+
+#endif
+
+} // namespace watch
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <vector>
+
+namespace watch
+{
+
+// Paths are relative to the watched root given by index
+struct Handler
+{
+    // A file was found, created or modified, and no write happened to it since `settleDelay`
+    std::function<void(size_t root, const std::filesystem::path &relPath)> changed;
+
+    // A file or directory was deleted or moved out of the root
+    std::function<void(size_t root, const std::filesystem::path &relPath, bool isDirectory)>
+        removed;
+
+    // A file or directory was renamed inside the root
+    std::function<void(size_t root,
+                       const std::filesystem::path &fromRelPath,
+                       const std::filesystem::path &toRelPath,
+                       bool isDirectory)>
+        moved;
+};
+
+constexpr int settleDelay = 200; // In milliseconds
+
+bool isSupported();
+
+// Watches the directory trees (with inotify on Linux) and calls the handler for every change in
+// them, starting with the files already present. Only returns by throwing std::system_error.
+void run(const std::vector<std::filesystem::path> &roots, const Handler &handler);
+
+} // namespace watch
@@ -6,6 +6,7 @@ add_requires(
     "fmt ^10.2.1",
     "freeimage ^3.18.0",
     "libsquish ^1.15",
+    "nlohmann_json ^3.11.2",
     "nowide_standalone ^11.3.0",
     "thread-pool ^4.1.0")
 
@@ -15,7 +16,7 @@ end
 
 target("BLPConverter")
     set_kind("binary")
-    add_packages("cli11", "fmt", "freeimage", "nowide_standalone", "thread-pool")
+    add_packages("cli11", "fmt", "freeimage", "nlohmann_json", "nowide_standalone", "thread-pool")
     if is_plat("windows") then
         add_packages("vc-ltl5")
     end